@@ -142,11 +142,33 @@ kernel HDRIrradiance : ImageComputationKernel<ePixelWise>
     {
         const float2 angles = cartesionUnitVectorToSpherical(rayDirection);
 
-        // Why does bilinear give nans? :(
-        return hdri(
-            round(__hdriPixelSize.x * angles.x) - 1,
-            round(hdri.bounds.height() - (__hdriPixelSize.y * angles.y)) - 1
+        const int width = hdri.bounds.width();
+        const int height = hdri.bounds.height();
+
+        // Pixel centres lie half a pixel in from their edges
+        const float2 indices = float2(
+            __hdriPixelSize.x * angles.x - 0.5f,
+            clamp(height - (__hdriPixelSize.y * angles.y) - 0.5f, 0.0f, height - 1.0f)
+        );
+
+        // The hdri is only a few pixels wide, so rounding to the nearest
+        // pixel would visibly rotate the irradiance. Interpolate by hand
+        // in order to wrap around the seam rather than clamp to it
+        const int left = (((int) floor(indices.x)) % width + width) % width;
+        const int right = (left + 1) % width;
+        const int bottom = (int) floor(indices.y);
+        const int top = min(bottom + 1, height - 1);
+        const float2 weight = indices - floor(indices);
+
+        const float4 bottomValue = (
+            (1.0f - weight.x) * hdri(left, bottom)
+            + weight.x * hdri(right, bottom)
+        );
+        const float4 topValue = (
+            (1.0f - weight.x) * hdri(left, top)
+            + weight.x * hdri(right, top)
         );
+        return (1.0f - weight.y) * bottomValue + weight.y * topValue;
     }
 
 
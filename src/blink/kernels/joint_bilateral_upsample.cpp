@@ -0,0 +1,129 @@
+// Copyright 2022 by Owen Bulka.
+// All rights reserved.
+// This file is released under the "MIT License Agreement".
+// Please see the LICENSE.md file that should have been included as part
+// of this package.
+
+//
+// BlinkScript Joint Bilateral Upsample
+//
+// Upsample an image that was rendered at a reduced resolution, guided
+// by the full resolution normals so that edges stay sharp.
+//
+
+
+/**
+ * Get the squared length of a vector.
+ *
+ * @arg vector: The vector.
+ *
+ * @returns: The squared length.
+ */
+inline float lengthSquared(const float3 &vector)
+{
+    return dot(vector, vector);
+}
+
+
+kernel JointBilateralUpsample : ImageComputationKernel<ePixelWise>
+{
+    Image<eRead, eAccessPoint, eEdgeClamped> normals;
+    Image<eRead, eAccessRandom, eEdgeClamped> lowResolutionNormals;
+    Image<eRead, eAccessRandom, eEdgeClamped> src;
+
+    // the output image
+    Image<eWrite> dst;
+
+
+    param:
+        // These parameters are made available to the user.
+
+        float _normalSigma;
+
+
+    local:
+        // These local variables are not exposed to the user.
+
+        float2 __scale;
+        float __normalFalloff;
+
+
+    /**
+     * Give the parameters labels and default values.
+     */
+    void define()
+    {
+        defineParam(_normalSigma, "Normal Sigma", 0.1f);
+    }
+
+
+    /**
+     * Initialize the local variables.
+     */
+    void init()
+    {
+        __scale = float2(
+            src.bounds.width() / (float) normals.bounds.width(),
+            src.bounds.height() / (float) normals.bounds.height()
+        );
+        __normalFalloff = 1.0f / (2.0f * max(_normalSigma * _normalSigma, 0.000001f));
+    }
+
+
+    /**
+     * Upsample a pixel, only blending the low resolution pixels that lie
+     * on the same surface as it.
+     *
+     * @arg pos: The x, and y location we are currently processing.
+     */
+    void process(int2 pos)
+    {
+        SampleType(normals) normal4 = normals();
+        const float3 normal = float3(normal4.x, normal4.y, normal4.z);
+
+        // The centre of this pixel in the low resolution image
+        const float2 position = max(
+            (float2(pos.x, pos.y) + float2(0.5f)) * __scale - float2(0.5f),
+            float2(0)
+        );
+        const int2 bottomLeft = int2(floor(position.x), floor(position.y));
+        const float2 bilinearWeight = position - float2(bottomLeft.x, bottomLeft.y);
+
+        float4 upsampledColour = float4(0);
+        float totalWeight = 0.0f;
+
+        for (int yOffset=0; yOffset <= 1; yOffset++)
+        {
+            // The second tap of the last row and column of the footprint lies
+            // past the top and right of the image, repeat the edge pixel there
+            const int y = min(bottomLeft.y + yOffset, src.bounds.height() - 1);
+            const float yWeight = yOffset == 0 ? 1.0f - bilinearWeight.y : bilinearWeight.y;
+
+            for (int xOffset=0; xOffset <= 1; xOffset++)
+            {
+                const int x = min(bottomLeft.x + xOffset, src.bounds.width() - 1);
+                const float xWeight = xOffset == 0 ? 1.0f - bilinearWeight.x : bilinearWeight.x;
+
+                const float4 lowResolutionNormal4 = lowResolutionNormals(x, y);
+                const float similarity = exp(
+                    -lengthSquared(
+                        float3(
+                            lowResolutionNormal4.x,
+                            lowResolutionNormal4.y,
+                            lowResolutionNormal4.z
+                        ) - normal
+                    ) * __normalFalloff
+                );
+
+                // Keep a little of the plain bilinear weight, so that a
+                // pixel unlike any of its neighbours still gets a colour
+                const float weight = xWeight * yWeight * max(similarity, 0.0001f);
+
+                upsampledColour += weight * src(x, y);
+                totalWeight += weight;
+            }
+        }
+
+        dst() = upsampledColour / totalWeight;
+    }
+};
@@ -0,0 +1,195 @@
+// Copyright 2022 by Owen Bulka.
+// All rights reserved.
+// This file is released under the "MIT License Agreement".
+// Please see the LICENSE.md file that should have been included as part
+// of this package.
+
+//
+// BlinkScript LatLong Blur
+//
+// One pass of a separable gaussian blur of a latlong image, measured
+// in angles on the sphere rather than pixels. The horizontal pass
+// widens towards the poles, where a pixel covers less of the sphere,
+// and wraps around the longitude seam. The vertical pass continues
+// over the poles onto the opposite longitude. The taps are never more
+// than a pixel apart, so bright features are not skipped, and never
+// reach further than across the image, so the cost is bounded by the
+// size of the image rather than the size of the blur.
+//
+
+
+/**
+ * Get the weight of a tap in a gaussian.
+ *
+ * @arg offset: The offset of the tap from the centre.
+ * @arg falloff: One over twice the variance of the gaussian.
+ *
+ * @returns: The weight of the tap.
+ */
+inline float gaussianWeight(const float offset, const float falloff)
+{
+    return exp(-offset * offset * falloff);
+}
+
+
+kernel LatLongBlur : ImageComputationKernel<ePixelWise>
+{
+    Image<eRead, eAccessRandom, eEdgeClamped> src;
+
+    // the output image
+    Image<eWrite> dst;
+
+
+    param:
+        // These parameters are made available to the user.
+
+        float _radius;
+        bool _vertical;
+
+
+    local:
+        // These local variables are not exposed to the user.
+
+        float2 __pixelsPerRadian;
+
+
+    /**
+     * Give the parameters labels and default values.
+     */
+    void define()
+    {
+        defineParam(_radius, "Radius", 0.05f);
+        defineParam(_vertical, "Vertical", false);
+    }
+
+
+    /**
+     * Initialize the local variables.
+     */
+    void init()
+    {
+        __pixelsPerRadian = float2(
+            src.bounds.width() / (2.0f * PI),
+            src.bounds.height() / PI
+        );
+    }
+
+
+    /**
+     * Read a pixel, wrapping around the longitude seam.
+     *
+     * @arg x: The x position of the pixel, which may lie outside the image.
+     * @arg y: The y position of the pixel.
+     *
+     * @returns: The colour of the pixel.
+     */
+    float4 readWrapped(const int x, const int y)
+    {
+        const int width = src.bounds.width();
+        return src(((x % width) + width) % width, y);
+    }
+
+
+    /**
+     * Read a pixel, continuing over the poles onto the opposite longitude.
+     *
+     * @arg x: The x position of the pixel.
+     * @arg y: The y position of the pixel, which may lie outside the image.
+     *
+     * @returns: The colour of the pixel.
+     */
+    float4 readOverPoles(const int x, const int y)
+    {
+        const int height = src.bounds.height();
+        if (y < 0 || y >= height)
+        {
+            // Reflect back from beyond the pole onto the opposite longitude.
+            // Only a blur taller than the image can reach past both poles,
+            // which the clamp catches
+            return readWrapped(
+                x + src.bounds.width() / 2,
+                clamp(y < 0 ? -1 - y : 2 * height - 1 - y, 0, height - 1)
+            );
+        }
+        return src(x, y);
+    }
+
+
+    /**
+     * Read between two pixels along the direction of the blur.
+     *
+     * @arg pos: The x, and y location we are currently processing.
+     * @arg offset: The offset in pixels along the direction of the blur.
+     *
+     * @returns: The linearly interpolated colour.
+     */
+    float4 readInterpolated(const int2 pos, const float offset)
+    {
+        const float floorOffset = floor(offset);
+        const int pixelOffset = (int) floorOffset;
+        const float weight = offset - floorOffset;
+
+        if (_vertical)
+        {
+            return (
+                (1.0f - weight) * readOverPoles(pos.x, pos.y + pixelOffset)
+                + weight * readOverPoles(pos.x, pos.y + pixelOffset + 1)
+            );
+        }
+        return (
+            (1.0f - weight) * readWrapped(pos.x + pixelOffset, pos.y)
+            + weight * readWrapped(pos.x + pixelOffset + 1, pos.y)
+        );
+    }
+
+
+    /**
+     * Blur a pixel along one direction.
+     *
+     * @arg pos: The x, and y location we are currently processing.
+     */
+    void process(int2 pos)
+    {
+        // Past a third of the height the blur spans pole to pole anyway
+        float sigma = min(
+            _radius * __pixelsPerRadian.y,
+            src.bounds.height() / 3.0f
+        );
+        if (!_vertical)
+        {
+            // A row of pixels is a smaller circle the closer it is to
+            // a pole, so the same angle spans more pixels
+            const float phi = PI * (1.0f - (pos.y + 0.5f) / src.bounds.height());
+            sigma = min(
+                _radius * __pixelsPerRadian.x / sin(phi),
+                src.bounds.width() / 6.0f
+            );
+        }
+
+        if (sigma < 0.25f)
+        {
+            dst() = src(pos.x, pos.y);
+            return;
+        }
+
+        // Spread the taps over three standard deviations either side, with
+        // at most a pixel between them
+        const int tapsPerSide = max(16, (int) ceil(3.0f * sigma));
+        const float tapSpacing = 3.0f * sigma / (float) tapsPerSide;
+        const float falloff = 1.0f / (2.0f * sigma * sigma);
+
+        float4 blurredColour = float4(0);
+        float totalWeight = 0.0f;
+
+        for (int tap=-tapsPerSide; tap <= tapsPerSide; tap++)
+        {
+            const float offset = tap * tapSpacing;
+            const float weight = gaussianWeight(offset, falloff);
+
+            blurredColour += weight * readInterpolated(pos, offset);
+            totalWeight += weight;
+        }
+
+        dst() = blurredColour / totalWeight;
+    }
+};
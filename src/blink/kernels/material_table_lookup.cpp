@@ -0,0 +1,59 @@
+// Copyright 2022 by Owen Bulka.
+// All rights reserved.
+// This file is released under the "MIT License Agreement".
+// Please see the LICENSE.md file that should have been included as part
+// of this package.
+
+//
+// BlinkScript Material Table Lookup
+//
+// Look up one row of the material table by each pixel's material id,
+// giving a full frame image of that material property.
+//
+
+
+kernel MaterialTableLookup : ImageComputationKernel<ePixelWise>
+{
+    Image<eRead, eAccessPoint, eEdgeClamped> materialIds;
+    Image<eRead, eAccessRandom, eEdgeClamped> materialTable;
+
+    // the output image
+    Image<eWrite> dst;
+
+
+    param:
+        // These parameters are made available to the user.
+
+        int _row;
+
+
+    /**
+     * Give the parameters labels and default values.
+     */
+    void define()
+    {
+        defineParam(_row, "Row", 0);
+    }
+
+
+    /**
+     * Read the material property of a pixel, rounding and clamping its
+     * id the same way as the NormalReflectionKernel.
+     *
+     * @arg pos: The x, and y location we are currently processing.
+     */
+    void process(int2 pos)
+    {
+        SampleType(materialIds) materialId4 = materialIds();
+        const int materialId = clamp(
+            (int) round(materialId4.x),
+            0,
+            materialTable.bounds.width() - 1
+        );
+
+        dst() = materialTable(
+            materialId,
+            clamp(_row, 0, materialTable.bounds.height() - 1)
+        );
+    }
+};
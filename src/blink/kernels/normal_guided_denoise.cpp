@@ -0,0 +1,171 @@
+// Copyright 2022 by Owen Bulka.
+// All rights reserved.
+// This file is released under the "MIT License Agreement".
+// Please see the LICENSE.md file that should have been included as part
+// of this package.
+
+//
+// BlinkScript Normal Guided Denoise
+//
+// A single pass of an edge-avoiding a-trous wavelet filter. Run this
+// several times with the step size doubling each pass to filter a
+// large area with only 25 taps per pixel per pass.
+//
+
+
+/**
+ * Get the weight of a tap in the 5 tap B3 spline kernel.
+ *
+ * @arg offset: The offset of the tap from the centre, in [-2, 2].
+ *
+ * @returns: The weight of the tap.
+ */
+inline float b3SplineWeight(const int offset)
+{
+    if (offset == 0)
+    {
+        return 0.375f;
+    }
+    if (offset == 1 || offset == -1)
+    {
+        return 0.25f;
+    }
+    return 0.0625f;
+}
+
+
+/**
+ * Get the squared length of a vector.
+ *
+ * @arg vector: The vector.
+ *
+ * @returns: The squared length.
+ */
+inline float lengthSquared(const float3 &vector)
+{
+    return dot(vector, vector);
+}
+
+
+kernel NormalGuidedDenoise : ImageComputationKernel<ePixelWise>
+{
+    Image<eRead, eAccessRandom, eEdgeClamped> normals;
+    Image<eRead, eAccessRandom, eEdgeClamped> albedo;
+    Image<eRead, eAccessRandom, eEdgeClamped> src;
+
+    // the output image
+    Image<eWrite> dst;
+
+
+    param:
+        // These parameters are made available to the user.
+
+        int _stepSize;
+        float _colourSigma;
+        float _normalSigma;
+        float _albedoSigma;
+
+
+    local:
+        // These local variables are not exposed to the user.
+
+        float __colourFalloff;
+        float __normalFalloff;
+        float __albedoFalloff;
+
+
+    /**
+     * Give the parameters labels and default values.
+     */
+    void define()
+    {
+        defineParam(_stepSize, "Step Size", 1);
+        defineParam(_colourSigma, "Colour Sigma", 1.0f);
+        defineParam(_normalSigma, "Normal Sigma", 0.3f);
+        defineParam(_albedoSigma, "Albedo Sigma", 0.1f);
+    }
+
+
+    /**
+     * Initialize the local variables.
+     */
+    void init()
+    {
+        __colourFalloff = 1.0f / (2.0f * max(_colourSigma * _colourSigma, 0.000001f));
+        __normalFalloff = 1.0f / (2.0f * max(_normalSigma * _normalSigma, 0.000001f));
+        __albedoFalloff = 1.0f / (2.0f * max(_albedoSigma * _albedoSigma, 0.000001f));
+    }
+
+
+    /**
+     * Filter a pixel, only blending with neighbours that lie on a similar
+     * surface.
+     *
+     * @arg pos: The x, and y location we are currently processing.
+     */
+    void process(int2 pos)
+    {
+        const float4 centreColour = src(pos.x, pos.y);
+
+        const float4 centreNormal4 = normals(pos.x, pos.y);
+        const float3 centreNormal = float3(centreNormal4.x, centreNormal4.y, centreNormal4.z);
+        if (centreNormal.x == 0.0f && centreNormal.y == 0.0f && centreNormal.z == 0.0f)
+        {
+            // The background is not noisy
+            dst() = centreColour;
+            return;
+        }
+
+        const float4 centreAlbedo4 = albedo(pos.x, pos.y);
+        const float3 centreAlbedo = float3(centreAlbedo4.x, centreAlbedo4.y, centreAlbedo4.z);
+
+        float4 filteredColour = float4(0);
+        float totalWeight = 0.0f;
+
+        for (int yOffset=-2; yOffset <= 2; yOffset++)
+        {
+            // The a-trous steps reach past the edges of the image near its
+            // border, repeat the edge pixels there
+            const int y = clamp(pos.y + yOffset * _stepSize, src.bounds.y1, src.bounds.y2 - 1);
+
+            for (int xOffset=-2; xOffset <= 2; xOffset++)
+            {
+                const int x = clamp(pos.x + xOffset * _stepSize, src.bounds.x1, src.bounds.x2 - 1);
+
+                const float4 normal4 = normals(x, y);
+                const float3 normal = float3(normal4.x, normal4.y, normal4.z);
+                if (normal.x == 0.0f && normal.y == 0.0f && normal.z == 0.0f)
+                {
+                    // Never bleed the background into the surface
+                    continue;
+                }
+
+                const float4 colour = src(x, y);
+                const float4 albedo4 = albedo(x, y);
+
+                const float4 colourDifference = colour - centreColour;
+                const float weight = (
+                    b3SplineWeight(xOffset)
+                    * b3SplineWeight(yOffset)
+                    * exp(
+                        -lengthSquared(float3(
+                            colourDifference.x,
+                            colourDifference.y,
+                            colourDifference.z
+                        )) * __colourFalloff
+                        - lengthSquared(normal - centreNormal) * __normalFalloff
+                        - lengthSquared(
+                            float3(albedo4.x, albedo4.y, albedo4.z) - centreAlbedo
+                        ) * __albedoFalloff
+                    )
+                );
+
+                filteredColour += weight * colour;
+                totalWeight += weight;
+            }
+        }
+
+        // The centre tap always contributes, so the weight is never zero
+        dst() = filteredColour / totalWeight;
+    }
+};
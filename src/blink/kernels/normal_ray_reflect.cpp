@@ -46,6 +46,22 @@ inline float3 blend(const float3 &value0, const float3 &value1, const float weig
 }
 
 
+/**
+ * Blend linearly between two values.
+ *
+ * @arg value0: The first value.
+ * @arg value1: The second value.
+ * @arg weight: The blend weight, 1 will return value0, and 0 will
+ *     return value1.
+ *
+ * @returns: The blended value.
+ */
+inline float4 blend(const float4 &value0, const float4 &value1, const float weight)
+{
+    return value1 + weight * (value0 - value1);
+}
+
+
 /**
  * Get the equivalent theta and phi values that lie between [0, 2 * PI),
  * and [0, PI) respectively.
@@ -86,6 +102,24 @@ inline float2 cartesionUnitVectorToSpherical(
 }
 
 
+/**
+ * Convert a spherical unit vector (unit radius) to cartesion.
+ *
+ * @arg angles: The spherical angles in radians.
+ *
+ * @returns: The equivalent cartesion vector.
+ */
+inline float3 sphericalUnitVectorToCartesion(const float2 &angles)
+{
+    const float sinPhi = sin(angles.y);
+    return float3(
+        cos(angles.x) * sinPhi,
+        cos(angles.y),
+        sin(angles.x) * sinPhi
+    );
+}
+
+
 /**
  * Get the position component of a world matrix.
  *
@@ -115,6 +149,25 @@ inline float saturate(float value)
 }
 
 
+/**
+ * Replace any nan channels of a colour with zero. A nan is the only
+ * value that is not equal to itself.
+ *
+ * @arg colour: The colour that may contain nans.
+ *
+ * @returns: The colour without nans.
+ */
+inline float4 removeNans(const float4 &colour)
+{
+    return float4(
+        colour.x == colour.x ? colour.x : 0.0f,
+        colour.y == colour.y ? colour.y : 0.0f,
+        colour.z == colour.z ? colour.z : 0.0f,
+        colour.w == colour.w ? colour.w : 0.0f
+    );
+}
+
+
 /**
  * Convert location of a pixel in an image into UV.
  *
@@ -379,6 +432,26 @@ inline float2 random(const float2 &seed)
 }
 
 
+/**
+ * Get a pair of random values for a pixel, so that no seed image is
+ * needed.
+ *
+ * @arg pixelLocation: The x, and y positions of the pixel.
+ * @arg offset: Offsets the seed, use different offsets to get
+ *     independent values for the same pixel. Offsets that differ by
+ *     a half give the same values for half of the pixels.
+ *
+ * @returns: Two random values on the interval [0, 1].
+ */
+inline float2 pixelSeed(const float2 &pixelLocation, const float offset)
+{
+    return random(float2(
+        fract(0.1031f * pixelLocation.x + 0.1127f * pixelLocation.y + offset),
+        fract(0.0973f * pixelLocation.x + 0.1099f * pixelLocation.y + offset)
+    ) + float2(offset));
+}
+
+
 /**
  * Create a random unit vector in the hemisphere aligned along the
  * z-axis, with a distribution that is cosine weighted.
@@ -453,22 +526,20 @@ float4x4 projectionMatrix(
 
 
 /**
- * Generate a ray out of a camera.
+ * Get the direction of a ray out of a camera, before it is normalized.
+ * This is linear in the UV position, so it can be interpolated.
  *
  * @arg cameraWorldMatrix: The camera matrix.
  * @arg inverseProjectionMatrix: The inverse of the projection matrix.
  * @arg uvPosition: The UV position in the resulting image.
- * @arg rayOrigin: Will store the origin of the ray.
- * @arg rayDirection: Will store the direction of the ray.
+ *
+ * @returns: The unnormalized direction of the ray.
  */
-void createCameraRay(
+float3 unnormalizedCameraRayDirection(
         const float4x4 &cameraWorldMatrix,
         const float4x4 &inverseProjectionMatrix,
-        const float2 &uvPosition,
-        float3 &rayOrigin,
-        float3 &rayDirection)
+        const float2 &uvPosition)
 {
-    positionFromWorldMatrix(cameraWorldMatrix, rayOrigin);
     float4 direction = matmul(
         inverseProjectionMatrix,
         float4(uvPosition.x, uvPosition.y, 0, 1)
@@ -478,7 +549,7 @@ void createCameraRay(
         float4(direction.x, direction.y, direction.z, 0),
         direction
     );
-    rayDirection = normalize(float3(direction.x, direction.y, direction.z));
+    return float3(direction.x, direction.y, direction.z);
 }
 
 
@@ -509,20 +580,17 @@ inline float3 reflectRayOffSurface(
  *
  * @arg incidentRayDirection: The incident direction.
  * @arg surfaceNormalDirection: The normal to the surface.
- * @arg incidentRefractiveIndex: The refractive index the incident ray
- *     is travelling through.
- * @arg refractedRefractiveIndex: The refractive index the refracted ray
- *     will be travelling through.
+ * @arg refractiveRatio: The refractive index the incident ray is
+ *     travelling through, divided by the refractive index the
+ *     refracted ray will be travelling through.
  *
  * @returns: The refracted ray direction.
  */
 inline float3 refractRayThroughSurface(
         const float3 &incidentRayDirection,
         const float3 &surfaceNormalDirection,
-        const float incidentRefractiveIndex,
-        const float refractedRefractiveIndex)
+        const float refractiveRatio)
 {
-    const float refractiveRatio = incidentRefractiveIndex / refractedRefractiveIndex;
     const float cosIncident = -dot(incidentRayDirection, surfaceNormalDirection);
     const float sinTransmittedSquared = refractiveRatio * refractiveRatio * (
         1.0f - cosIncident * cosIncident
@@ -540,32 +608,123 @@ inline float3 refractRayThroughSurface(
 
 
 /**
- * Compute the schlick, simplified fresnel reflection coefficient.
+ * Get a unit tangent to a surface, rotated about the normal. This is
+ * the direction anisotropic roughness is stretched along.
  *
- * @arg incidentRayDirection: The incident direction.
  * @arg surfaceNormalDirection: The normal to the surface.
+ * @arg rotation: The angle to rotate the tangent about the normal, in
+ *     radians.
+ *
+ * @returns: The tangent.
+ */
+inline float3 surfaceTangent(const float3 &surfaceNormalDirection, const float rotation)
+{
+    float3 tangent;
+    if (fabs(surfaceNormalDirection.y) < 0.999f)
+    {
+        tangent = normalize(cross(float3(0, 1, 0), surfaceNormalDirection));
+    }
+    else
+    {
+        tangent = normalize(cross(float3(1, 0, 0), surfaceNormalDirection));
+    }
+    return (
+        cos(rotation) * tangent
+        + sin(rotation) * cross(surfaceNormalDirection, tangent)
+    );
+}
+
+
+/**
+ * Roughen the direction a smooth surface would scatter a ray in, by
+ * blending it towards a random direction in the hemisphere. Anisotropy
+ * scales the blend differently along, and across, the tangent, so it
+ * costs no more than isotropic roughness.
+ *
+ * @arg sharpDirection: The direction a perfectly smooth surface would
+ *     scatter the ray in.
+ * @arg diffuseDirection: A random direction in the hemisphere about
+ *     the normal.
+ * @arg roughness: The roughness of the surface.
+ * @arg tangent: The unit tangent the roughness is stretched along.
+ * @arg bitangent: The unit tangent perpendicular to the tangent.
+ * @arg anisotropy: On the interval [-1, 1], positive values stretch the
+ *     roughness along the tangent, negative values across it, and 0 is
+ *     isotropic.
+ *
+ * @returns: The roughened direction.
+ */
+inline float3 roughenDirection(
+        const float3 &sharpDirection,
+        const float3 &diffuseDirection,
+        const float roughness,
+        const float3 &tangent,
+        const float3 &bitangent,
+        const float anisotropy)
+{
+    if (anisotropy == 0.0f)
+    {
+        return normalize(blend(diffuseDirection, sharpDirection, roughness));
+    }
+
+    const float3 offset = diffuseDirection - sharpDirection;
+    const float3 tangentOffset = dot(offset, tangent) * tangent;
+    const float3 bitangentOffset = dot(offset, bitangent) * bitangent;
+
+    return normalize(
+        sharpDirection
+        + roughness * (offset - tangentOffset - bitangentOffset)
+        + saturate(roughness * (1.0f + anisotropy)) * tangentOffset
+        + saturate(roughness * (1.0f - anisotropy)) * bitangentOffset
+    );
+}
+
+
+/**
+ * Compute the reflection coefficient at normal incidence, which only
+ * depends on the refractive indices.
+ *
  * @arg incidentRefractiveIndex: The refractive index the incident ray
  *     is travelling through.
  * @arg refractedRefractiveIndex: The refractive index the refracted ray
  *     will be travelling through.
  *
- * @returns: The reflection coefficient.
+ * @returns: The reflection coefficient at normal incidence.
  */
-float schlickReflectionCoefficient(
-        const float3 &incidentRayDirection,
-        const float3 &surfaceNormalDirection,
+inline float schlickParallelCoefficient(
         const float incidentRefractiveIndex,
         const float refractedRefractiveIndex)
 {
-    const float parallelCoefficient = pow(
+    return pow(
         (incidentRefractiveIndex - refractedRefractiveIndex)
         / (incidentRefractiveIndex + refractedRefractiveIndex),
         2
     );
+}
+
+
+/**
+ * Compute the schlick, simplified fresnel reflection coefficient.
+ *
+ * @arg incidentRayDirection: The incident direction.
+ * @arg surfaceNormalDirection: The normal to the surface.
+ * @arg refractiveRatio: The refractive index the incident ray is
+ *     travelling through, divided by the refractive index the
+ *     refracted ray will be travelling through.
+ * @arg parallelCoefficient: The reflection coefficient at normal
+ *     incidence, see schlickParallelCoefficient.
+ *
+ * @returns: The reflection coefficient.
+ */
+float schlickReflectionCoefficient(
+        const float3 &incidentRayDirection,
+        const float3 &surfaceNormalDirection,
+        const float refractiveRatio,
+        const float parallelCoefficient)
+{
     float cosX = -dot(surfaceNormalDirection, incidentRayDirection);
-    if (incidentRefractiveIndex > refractedRefractiveIndex)
+    if (refractiveRatio > 1.0f)
     {
-        const float refractiveRatio = incidentRefractiveIndex / refractedRefractiveIndex;
         const float sinTransmittedSquared = refractiveRatio * refractiveRatio * (
             1.0f - cosX * cosX
         );
@@ -579,10 +738,81 @@ float schlickReflectionCoefficient(
 }
 
 
+//
+// Lights
+//
+
+
+/**
+ * Get the radiance of a light, spread evenly over a cone around a
+ * scattered ray, so that a rough surface blurs the light without any
+ * sampling. The cone is elliptical when the roughness is anisotropic,
+ * and its edge is softened to avoid a hard cutoff.
+ *
+ * @arg coneDirection: The direction of the centre of the cone.
+ * @arg lightDirection: The direction of the light.
+ * @arg lightIrradiance: The irradiance of the light, facing it.
+ * @arg lightRadius: The angular radius of the light, in radians.
+ * @arg coneRadii: The angular radii the roughness spreads the scattered
+ *     rays over, along, and across, the tangent, in radians.
+ * @arg tangent: The tangent the first radius lies along, it is
+ *     projected onto the plane perpendicular to the cone.
+ *
+ * @returns: The radiance of the light seen along the cone.
+ */
+inline float4 lightRadianceInCone(
+        const float3 &coneDirection,
+        const float3 &lightDirection,
+        const float4 &lightIrradiance,
+        const float lightRadius,
+        const float2 &coneRadii,
+        const float3 &tangent)
+{
+    const float2 radii = float2(
+        max(lightRadius, coneRadii.x),
+        max(lightRadius, coneRadii.y)
+    );
+
+    // The radius of the ellipse in the direction of the light
+    float radius = radii.x;
+    const float3 coneTangent = tangent - dot(tangent, coneDirection) * coneDirection;
+    if (radii.x != radii.y && dot(coneTangent, coneTangent) > 0.000001f)
+    {
+        const float3 unitConeTangent = normalize(coneTangent);
+        const float alongTangent = dot(lightDirection, unitConeTangent);
+        const float acrossTangent = dot(
+            lightDirection,
+            cross(coneDirection, unitConeTangent)
+        );
+        const float offsetSquared = max(
+            alongTangent * alongTangent + acrossTangent * acrossTangent,
+            0.000001f
+        );
+        radius = sqrt(offsetSquared / (
+            alongTangent * alongTangent / (radii.x * radii.x)
+            + acrossTangent * acrossTangent / (radii.y * radii.y)
+        ));
+    }
+
+    const float cosOuterRadius = cos(radius);
+    const float cosInnerRadius = cos(0.8f * radius);
+    const float coverage = saturate(
+        (dot(coneDirection, lightDirection) - cosOuterRadius)
+        / (cosInnerRadius - cosOuterRadius)
+    );
+
+    // Normalize by the solid angle halfway through the soft edge, an
+    // ellipse covers about the same solid angle as a circle with the
+    // geometric mean of its radii
+    return coverage * lightIrradiance / (
+        2.0f * PI * (1.0f - cos(0.9f * sqrt(radii.x * radii.y)))
+    );
+}
+
+
 kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
 {
     Image<eRead, eAccessPoint, eEdgeClamped> normals;
-    Image<eRead, eAccessPoint, eEdgeClamped> seeds;
     Image<eRead, eAccessPoint, eEdgeClamped> diffuse;
     Image<eRead, eAccessPoint, eEdgeClamped> specular;
     Image<eRead, eAccessPoint, eEdgeClamped> transmission;
@@ -590,6 +820,13 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
 
     Image<eRead, eAccessRandom, eEdgeClamped> hdri;
     Image<eRead, eAccessRandom, eEdgeClamped> irradiance;
+    Image<eRead, eAccessRandom, eEdgeClamped> roughHDRI;
+
+    // Material id mode, a table with one column per material id and rows
+    // 0: diffuse, 1: specular, 2: transmission, 3: material properties,
+    // 4: incident and refracted refractive indices
+    Image<eRead, eAccessPoint, eEdgeClamped> materialIds;
+    Image<eRead, eAccessRandom, eEdgeClamped> materialTable;
 
     // the output image
     Image<eWrite> dst;
@@ -614,21 +851,46 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
 
         // Ray Params
         int _samples;
+        float _roughLookupThreshold;
+        int _coherentTileSize;
+
+        // Output params, 0: beauty, 1: diffuse, 2: specular,
+        // 3: transmission, 4: fresnel
+        int _outputLobe;
 
         float _incidentRefractiveIndex;
         float _refractedRefractiveIndex;
 
+        bool _useMaterialTable;
+
+        // Extracted light params
+        bool _useExtractedLight;
+        float2 _lightAngles;
+        float4 _lightIrradiance;
+        float _lightRadius;
+
 
     local:
         // These local variables are not exposed to the user.
 
         float4x4 __inverseCameraProjectionMatrix;
+        float3 __cameraPosition;
+        float3 __rayDirectionOrigin;
+        float3 __rayDirectionStepX;
+        float3 __rayDirectionStepY;
         float __aperture;
 
         float2 __hdriPixelSize;
+        float2 __roughHDRIPixelSize;
         float __hdriOffsetRadians;
         float2 __irradiancePixelSize;
 
+        float __refractiveRatio;
+        float __parallelReflectionCoefficient;
+
+        float3 __lightDirection;
+        float __lightRadius;
+
 
     /**
      * Give the parameters labels and default values.
@@ -659,8 +921,18 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
 
         // Ray Params
         defineParam(_samples, "Samples", 1);
+        defineParam(_roughLookupThreshold, "Rough Lookup Threshold", 0.25f);
+        defineParam(_coherentTileSize, "Coherent Tile Size", 0);
+        defineParam(_outputLobe, "Output Lobe", 0);
         defineParam(_incidentRefractiveIndex, "Incident Refractive Index", 1.0f);
         defineParam(_refractedRefractiveIndex, "Refracted Refractive Index", 1.33f);
+        defineParam(_useMaterialTable, "Use Material Table", false);
+
+        // Extracted light params
+        defineParam(_useExtractedLight, "Use Extracted Light", false);
+        defineParam(_lightAngles, "Light Angles", float2(0.0f, 0.0f));
+        defineParam(_lightIrradiance, "Light Irradiance", float4(0.0f));
+        defineParam(_lightRadius, "Light Radius", 0.5f);
     }
 
 
@@ -679,15 +951,54 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
         );
         __inverseCameraProjectionMatrix = cameraProjectionMatrix.invert();
 
+        // The ray direction, before normalization, is linear in the pixel
+        // location, so store the direction at the origin and the step per
+        // pixel rather than transforming every ray
+        const float2 format = float2(_formatWidth, _formatHeight);
+        positionFromWorldMatrix(_cameraWorldMatrix, __cameraPosition);
+        __rayDirectionOrigin = unnormalizedCameraRayDirection(
+            _cameraWorldMatrix,
+            __inverseCameraProjectionMatrix,
+            pixelsToUV(float2(0, 0), format)
+        );
+        __rayDirectionStepX = unnormalizedCameraRayDirection(
+            _cameraWorldMatrix,
+            __inverseCameraProjectionMatrix,
+            pixelsToUV(float2(1, 0), format)
+        ) - __rayDirectionOrigin;
+        __rayDirectionStepY = unnormalizedCameraRayDirection(
+            _cameraWorldMatrix,
+            __inverseCameraProjectionMatrix,
+            pixelsToUV(float2(0, 1), format)
+        ) - __rayDirectionOrigin;
+
         __hdriPixelSize = float2(
             hdri.bounds.width() / (2 * PI),
             hdri.bounds.height() / PI
         );
+        __roughHDRIPixelSize = float2(
+            roughHDRI.bounds.width() / (2 * PI),
+            roughHDRI.bounds.height() / PI
+        );
         __irradiancePixelSize = float2(
             irradiance.bounds.width() / (2 * PI),
             irradiance.bounds.height() / PI
         );
         __hdriOffsetRadians = degreesToRadians(_hdriOffsetAngle);
+
+        // The light angles are in the hdri, so undo the offset that is
+        // applied to every ray before it reads the hdri
+        __lightDirection = sphericalUnitVectorToCartesion(float2(
+            degreesToRadians(_lightAngles.x) - __hdriOffsetRadians,
+            degreesToRadians(_lightAngles.y)
+        ));
+        __lightRadius = max(degreesToRadians(_lightRadius), 0.001f);
+
+        __refractiveRatio = _incidentRefractiveIndex / _refractedRefractiveIndex;
+        __parallelReflectionCoefficient = schlickParallelCoefficient(
+            _incidentRefractiveIndex,
+            _refractedRefractiveIndex
+        );
     }
 
 
@@ -718,13 +1029,15 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
 
 
     /**
-     * Get the value of irradiance the hdri would provide in a direction
+     * Get the value of the low resolution copy of the hdri the ray would
+     * hit at infinite distance. This is small enough to stay in cache
+     * when the rays are scattered all over the sphere.
      *
      * @arg rayDirection: The direction of the ray.
      *
      * @returns: The colour of the pixel in the direction of the ray.
      */
-    inline float4 readIrradianceValue(float3 rayDirection)
+    float4 readRoughHDRIValue(float3 rayDirection)
     {
         const float2 angles = cartesionUnitVectorToSpherical(rayDirection, __hdriOffsetRadians);
 
@@ -732,42 +1045,186 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
         // but I see nan pixels sooo... :(
         const float2 indices = clamp(
             float2(
-                __irradiancePixelSize.x * angles.x,
-                irradiance.bounds.height() - (__irradiancePixelSize.y * angles.y)
+                __roughHDRIPixelSize.x * angles.x,
+                roughHDRI.bounds.height() - (__roughHDRIPixelSize.y * angles.y)
             ),
             float2(0),
-            float2(irradiance.bounds.width(), irradiance.bounds.height()) - 1.0f
+            float2(roughHDRI.bounds.width(), roughHDRI.bounds.height()) - 1.0f
         );
 
-        return bilinear(irradiance, indices.x, indices.y);
+        return bilinear(roughHDRI, indices.x, indices.y);
+    }
+
+
+    /**
+     * Get the value of hdri a ray that was scattered by a surface would
+     * hit. Rays scattered by rough surfaces are blurred by the sampling
+     * anyway, so they read from the low resolution copy of the hdri.
+     *
+     * @arg rayDirection: The direction of the ray.
+     * @arg roughness: The roughness of the surface that scattered the
+     *     ray.
+     *
+     * @returns: The colour of the pixel in the direction of the ray.
+     */
+    float4 readScatteredHDRIValue(float3 rayDirection, float roughness)
+    {
+        if (roughness > _roughLookupThreshold)
+        {
+            return readRoughHDRIValue(rayDirection);
+        }
+        return readHDRIValue(rayDirection);
+    }
+
+
+    /**
+     * Get the light arriving along a lobe scattered by a surface, which
+     * may be rough.
+     *
+     * @arg sharpDirection: The direction a perfectly smooth surface would
+     *     scatter the ray in.
+     * @arg diffuseDirection: A random direction in the hemisphere about
+     *     the normal, used to roughen the lobe.
+     * @arg normal: The normal the diffuse directions are distributed
+     *     about.
+     * @arg roughness: The roughness of the surface.
+     * @arg tangent: The unit tangent anisotropic roughness is stretched
+     *     along.
+     * @arg bitangent: The unit tangent perpendicular to the tangent.
+     * @arg anisotropy: The anisotropy of the roughness, see
+     *     roughenDirection.
+     *
+     * @returns: The colour seen along the lobe.
+     */
+    float4 readLobeValue(
+            const float3 &sharpDirection,
+            const float3 &diffuseDirection,
+            const float3 &normal,
+            const float roughness,
+            const float3 &tangent,
+            const float3 &bitangent,
+            const float anisotropy)
+    {
+        // The lookup is chosen by the widest axis of the lobe, clamped so
+        // that a threshold of 1 still always reads the full hdri
+        float4 lobeValue = readScatteredHDRIValue(
+            roughenDirection(
+                sharpDirection,
+                diffuseDirection,
+                roughness,
+                tangent,
+                bitangent,
+                anisotropy
+            ),
+            min(roughness * (1.0f + fabs(anisotropy)), 1.0f)
+        );
+        const float cosLightAngle = dot(normal, __lightDirection);
+        if (_useExtractedLight && cosLightAngle > 0.0f)
+        {
+            // The light was removed from the hdri, so add it back in closed
+            // form rather than sampling it. The cone is stretched along the
+            // tangent in the same way as roughenDirection stretches the
+            // sampled rays
+            const float4 coneRadiance = lightRadianceInCone(
+                sharpDirection,
+                __lightDirection,
+                _lightIrradiance,
+                __lightRadius,
+                float2(
+                    saturate(roughness * (1.0f + anisotropy)),
+                    saturate(roughness * (1.0f - anisotropy))
+                ) * PI / 2.0f,
+                tangent
+            );
+
+            // Fully rough lobes scatter along the cosine weighted diffuse
+            // directions, so they see the light in the same way as the
+            // diffuse lighting does, and in the same way as they see the
+            // rest of the hdri. Lights below the surface are never seen
+            lobeValue += blend(
+                _lightIrradiance * cosLightAngle / PI,
+                coneRadiance,
+                saturate(roughness)
+            );
+        }
+        return lobeValue;
+    }
+
+
+    /**
+     * Get the value of irradiance the hdri would provide in a direction
+     *
+     * @arg rayDirection: The direction of the ray.
+     *
+     * @returns: The colour of the pixel in the direction of the ray.
+     */
+    inline float4 readIrradianceValue(float3 rayDirection)
+    {
+        const float2 angles = cartesionUnitVectorToSpherical(rayDirection, __hdriOffsetRadians);
+
+        const int width = irradiance.bounds.width();
+        const int height = irradiance.bounds.height();
+        const float2 indices = float2(
+            __irradiancePixelSize.x * angles.x,
+            clamp(height - (__irradiancePixelSize.y * angles.y), 0.0f, height - 1.0f)
+        );
+
+        // The irradiance is only a few pixels wide, so interpolate by hand
+        // in order to wrap around the seam rather than clamp to it
+        const int left = ((int) floor(indices.x)) % width;
+        const int right = (left + 1) % width;
+        const int bottom = (int) floor(indices.y);
+        const int top = min(bottom + 1, height - 1);
+        const float2 weight = indices - floor(indices);
+
+        return blend(
+            blend(irradiance(right, top), irradiance(left, top), weight.x),
+            blend(irradiance(right, bottom), irradiance(left, bottom), weight.x),
+            weight.y
+        );
     }
 
 
     /**
      * Create a ray out of the camera
      *
-     * @arg pixelLocation: The x, and y locations of the pixel.
+     * @arg pixelLocation: The x, and y locations of the pixel, including
+     *     any sub-pixel offset.
      * @arg rayOrigin: The location to store the origin of the new ray.
      * @arg rayDirection: The location to store the direction of the new
      *     ray.
      */
     void getCameraRay(
-            const float2 &seed,
             const float2 &pixelLocation,
             float3 &rayOrigin,
             float3 &rayDirection)
     {
-        const float2 uvCoordinates = pixelsToUV(
-            pixelLocation + random(seed),
-            float2(_formatWidth, _formatHeight)
+        rayOrigin = __cameraPosition;
+        rayDirection = normalize(
+            __rayDirectionOrigin
+            + pixelLocation.x * __rayDirectionStepX
+            + pixelLocation.y * __rayDirectionStepY
         );
+    }
 
-        createCameraRay(
-            _cameraWorldMatrix,
-            __inverseCameraProjectionMatrix,
-            uvCoordinates,
-            rayOrigin,
-            rayDirection
+
+    /**
+     * Get a stratified sub-pixel offset. Each sample gets its own column
+     * of the pixel, and the rows step by the golden ratio so they are
+     * evenly spread for any number of samples. The whole pattern is
+     * shifted randomly per pixel, which keeps every sample uniform over
+     * the pixel, so the samples average to its centre.
+     *
+     * @arg sample: The index of the sample, starting at 0.
+     * @arg shift: The random shift of the pixel's pattern.
+     *
+     * @returns: The offset within the pixel, on the interval [0, 1].
+     */
+    float2 stratifiedPixelOffset(const int sample, const float2 &shift)
+    {
+        return float2(
+            (sample + shift.x) / (float) _samples,
+            fract(shift.y + 0.618034f * sample)
         );
     }
 
@@ -781,10 +1238,6 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
     {
         const float2 pixelLocation = float2(pos.x, pos.y);
 
-        SampleType(seeds) seed4 = seeds();
-        float2 seed0 = float2(seed4.x, seed4.y);
-        float2 seed1 = float2(seed4.z, seed4.w);
-
         SampleType(normals) normal = normals();
         const float3 normalDirection = float3(
             normal.x,
@@ -792,10 +1245,90 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
             normal.z
         );
 
-        const float4 diffuseColour = diffuse();
-        const float4 specularColour = specular();
-        const float4 transmissionColour = transmission();
-        const float4 materialProperties = material();
+        if (
+            normalDirection.x == 0.0f
+            && normalDirection.y == 0.0f
+            && normalDirection.z == 0.0f
+        ) {
+            // Background pixels only see the HDRI, so skip the material
+            // reads and the sample loop, one ray through the centre will do
+            float3 rayOrigin;
+            float3 rayDirection;
+            getCameraRay(pixelLocation + float2(0.5f), rayOrigin, rayDirection);
+
+            if (_outputLobe == 0)
+            {
+                dst() = removeNans(readLobeValue(
+                    rayDirection,
+                    rayDirection,
+                    rayDirection,
+                    0.0f,
+                    float3(0),
+                    float3(0),
+                    0.0f
+                ));
+            }
+            else
+            {
+                dst() = float4(0);
+            }
+            return;
+        }
+
+        // Sharing the seeds across a tile makes neighbouring pixels scatter
+        // their rays in similar directions, so their reads from the hdri
+        // land close together, at the cost of the noise being blocky
+        float2 seedLocation = pixelLocation;
+        if (_coherentTileSize > 1)
+        {
+            seedLocation = floor(pixelLocation / (float) _coherentTileSize);
+        }
+        float2 seed0 = pixelSeed(seedLocation, 0.0f);
+        float2 seed1 = pixelSeed(seedLocation, 0.3183f);
+        const float2 pixelShift = random(seed0 + seed1);
+
+        float4 diffuseColour;
+        float4 specularColour;
+        float4 transmissionColour;
+        float4 materialProperties;
+        float refractiveRatio = __refractiveRatio;
+        float parallelReflectionCoefficient = __parallelReflectionCoefficient;
+        if (_useMaterialTable)
+        {
+            // Look the whole material up by id instead of reading four
+            // images, this also gives every material its own refractive
+            // indices
+            SampleType(materialIds) materialId4 = materialIds();
+            const int materialId = clamp(
+                (int) round(materialId4.x),
+                0,
+                materialTable.bounds.width() - 1
+            );
+
+            diffuseColour = materialTable(materialId, 0);
+            specularColour = materialTable(materialId, 1);
+            transmissionColour = materialTable(materialId, 2);
+            materialProperties = materialTable(materialId, 3);
+
+            // An empty refractive index row keeps the knobs' indices, rather
+            // than dividing by zero
+            const float4 refractiveIndices = materialTable(materialId, 4);
+            if (refractiveIndices.x > 0.0f && refractiveIndices.y > 0.0f)
+            {
+                refractiveRatio = refractiveIndices.x / refractiveIndices.y;
+                parallelReflectionCoefficient = schlickParallelCoefficient(
+                    refractiveIndices.x,
+                    refractiveIndices.y
+                );
+            }
+        }
+        else
+        {
+            diffuseColour = diffuse();
+            specularColour = specular();
+            transmissionColour = transmission();
+            materialProperties = material();
+        }
 
         const float specular = saturate(specularColour.w);
         float transmission;
@@ -811,9 +1344,33 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
 
         const float specularRoughness = materialProperties.x * materialProperties.x;
         const float transmissionRoughness = materialProperties.y * materialProperties.y;
-        // TODO: use material properties z and w slots to represent something, maybe anisotropy
-
-        float4 resultPixel = float4(0);
+        const float anisotropy = clamp(materialProperties.z, -1.0f, 1.0f);
+        const float3 tangent = surfaceTangent(normalDirection, PI * materialProperties.w);
+        const float3 bitangent = cross(normalDirection, tangent);
+
+        const float4 diffuseWeight = diffuse * diffuseColour;
+        const float4 transmissionWeight = transmission * transmissionColour / (1.0f - specular);
+
+        // Accumulate each lobe separately so any of them can be output
+        float4 diffusePixel = float4(0);
+        float4 specularPixel = float4(0);
+        float4 transmissionPixel = float4(0);
+        float fresnelTotal = 0.0f;
+        if (diffuse > 0.0f && _usePrecomputedIrradiance)
+        {
+            // The irradiance only depends on the normal, so it is the same
+            // for every sample
+            diffusePixel = (float) _samples * diffuseWeight * readIrradianceValue(normalDirection);
+        }
+        if (diffuse > 0.0f && _useExtractedLight)
+        {
+            // Like the irradiance, the light's diffuse contribution is the
+            // same for every sample
+            diffusePixel += (
+                (float) _samples * diffuseWeight * _lightIrradiance
+                * positivePart(dot(normalDirection, __lightDirection)) / PI
+            );
+        }
 
         for (int sample=1; sample <= _samples; sample++)
         {
@@ -821,81 +1378,69 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
             float3 rayOrigin;
             float3 rayDirection;
             getCameraRay(
-                seed0,
-                pixelLocation,
+                pixelLocation + stratifiedPixelOffset(sample - 1, pixelShift),
                 rayOrigin,
                 rayDirection
             );
 
-            if (
-                normalDirection.x != 0.0f
-                || normalDirection.y != 0.0f
-                || normalDirection.z != 0.0f
-            ) {
-                // Get the diffuse direction for the next ray
-                const float3 diffuseDirection = cosineDirectionInHemisphere(
+            // Get the diffuse direction for the next ray
+            const float3 diffuseDirection = cosineDirectionInHemisphere(
+                normalDirection,
+                seed1
+            );
+
+            if (diffuse > 0.0f && !_usePrecomputedIrradiance)
+            {
+                diffusePixel += diffuseWeight * readScatteredHDRIValue(diffuseDirection, 1.0f);
+            }
+            float fresnelSpecular = specular;
+            if (transmission > 0.0f || specular > 0.0f)
+            {
+                const float reflectivity = schlickReflectionCoefficient(
+                    rayDirection,
                     normalDirection,
-                    seed1
+                    refractiveRatio,
+                    parallelReflectionCoefficient
                 );
 
-                if (diffuse > 0.0f)
-                {
-                    if (_usePrecomputedIrradiance)
-                    {
-                        resultPixel += diffuse * diffuseColour * readIrradianceValue(normalDirection);
-                    }
-                    else
-                    {
-                        resultPixel += diffuse * diffuseColour * readHDRIValue(diffuseDirection);
-                    }
-                }
-                float fresnelSpecular = specular;
-                if (transmission > 0.0f || specular > 0.0f)
-                {
-                    const float reflectivity = schlickReflectionCoefficient(
-                        rayDirection,
-                        normalDirection,
-                        _incidentRefractiveIndex,
-                        _refractedRefractiveIndex
-                    );
+                fresnelSpecular = blend(1.0f, specular, reflectivity);
 
-                    fresnelSpecular = blend(1.0f, specular, reflectivity);
-
-                    if (transmission > 0.0f)
-                    {
-                        resultPixel += (
-                            transmission * transmissionColour * (1.0f - fresnelSpecular)
-                            * readHDRIValue(normalize(blend(
-                                diffuseDirection,
-                                refractRayThroughSurface(
-                                    rayDirection,
-                                    normalDirection,
-                                    _incidentRefractiveIndex,
-                                    _refractedRefractiveIndex
-                                ),
-                                transmissionRoughness
-                            )))
-                            / (1.0f - specular)
-                        );
-                        
-                    }
-                }
-                if (fresnelSpecular > 0.0f)
+                if (transmission > 0.0f)
                 {
-                    resultPixel += (
-                        fresnelSpecular * specularColour
-                        * readHDRIValue(normalize(blend(
+                    transmissionPixel += (
+                        transmissionWeight * (1.0f - fresnelSpecular)
+                        * readLobeValue(
+                            refractRayThroughSurface(
+                                rayDirection,
+                                normalDirection,
+                                refractiveRatio
+                            ),
                             diffuseDirection,
-                            reflectRayOffSurface(rayDirection, normalDirection),
-                            specularRoughness
-                        )))
+                            normalDirection,
+                            transmissionRoughness,
+                            tangent,
+                            bitangent,
+                            anisotropy
+                        )
                     );
                 }
             }
-            else
+            if (fresnelSpecular > 0.0f)
             {
-                resultPixel += readHDRIValue(rayDirection);
+                specularPixel += (
+                    fresnelSpecular * specularColour
+                    * readLobeValue(
+                        reflectRayOffSurface(rayDirection, normalDirection),
+                        diffuseDirection,
+                        normalDirection,
+                        specularRoughness,
+                        tangent,
+                        bitangent,
+                        anisotropy
+                    )
+                );
             }
+            fresnelTotal += fresnelSpecular;
 
             // Update the seeds in as unbiased a way as we can think of
             seed0 = random(seed1 + random(seed0));
@@ -909,6 +1454,30 @@ kernel NormalReflectionKernel : ImageComputationKernel<ePixelWise>
             seed0.x = x;
         }
 
-        dst() = resultPixel / (float) _samples;
+        float4 resultPixel;
+        if (_outputLobe == 1)
+        {
+            resultPixel = diffusePixel;
+        }
+        else if (_outputLobe == 2)
+        {
+            resultPixel = specularPixel;
+        }
+        else if (_outputLobe == 3)
+        {
+            resultPixel = transmissionPixel;
+        }
+        else if (_outputLobe == 4)
+        {
+            resultPixel = float4(fresnelTotal);
+        }
+        else
+        {
+            resultPixel = diffusePixel + specularPixel + transmissionPixel;
+        }
+
+        // Scrubbing the nans here rather than in a separate node saves
+        // writing, and reading back, another full frame copy
+        dst() = removeNans(resultPixel / (float) _samples);
     }
 };
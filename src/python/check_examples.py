@@ -0,0 +1,261 @@
+"""Render the example scripts and check them against stored goldens.
+
+Run this from Nuke's terminal mode after changing a kernel:
+
+    nuke -t src/python/check_examples.py
+
+Every N_RayReflect node in the checked scripts is rendered with a fixed
+number of ray samples. The kernels seed their random numbers from the
+pixel location, so the renders are repeatable. Each render must be
+within a PSNR and a maximum error of its golden image in
+examples/golden, and must not be much slower than the recorded timing.
+The check fails if any golden or timing is missing.
+
+After a change that is meant to alter the image, or to record timings
+for a new machine, store new goldens and timings with:
+
+    nuke -t src/python/check_examples.py --update
+"""
+import argparse
+import json
+import math
+import os
+import sys
+import tempfile
+import time
+
+import nuke
+
+
+_REPO_DIR = os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+_EXAMPLES_DIR = os.path.join(_REPO_DIR, "examples")
+_GOLDEN_DIR = os.path.join(_EXAMPLES_DIR, "golden")
+_TIMINGS_FILE = os.path.join(_GOLDEN_DIR, "timings.json")
+
+# Only scripts with geometry, the background alone does not exercise the
+# shading
+_SCRIPTS = ["material_fixture.nk", "variable_surface_example.nk"]
+
+_RAY_SAMPLES = 16
+
+
+def open_script(path):
+    """Open a script containing the gizmo.
+
+    Args:
+        path (str): The path to the script.
+    """
+    nuke.pluginAddPath(os.path.join(_REPO_DIR, "src", "gizmos"))
+    nuke.scriptClear()
+    nuke.scriptOpen(path)
+
+
+def render(node, path, frame):
+    """Render a node to a 32 bit exr.
+
+    Args:
+        node (nuke.Node): The node to render.
+        path (str): The file to write.
+        frame (int): The frame to render.
+
+    Returns:
+        float: The time taken to render, in seconds.
+    """
+    write = nuke.nodes.Write(file=path.replace("\\", "/"), file_type="exr")
+    write["datatype"].setValue("32 bit float")
+    write["channels"].setValue("rgba")
+    write.setInput(0, node)
+
+    start = time.time()
+    nuke.execute(write, frame, frame)
+    elapsed = time.time() - start
+
+    nuke.delete(write)
+    return elapsed
+
+
+def surface_fraction(node, frame):
+    """Measure how much of a node's image is covered by a surface.
+
+    Args:
+        node (nuke.Node): The N_RayReflect node.
+        frame (int): The frame to measure.
+
+    Returns:
+        float: The fraction of the pixels with a normal.
+    """
+    layer = node["in"].value()
+    coverage = nuke.nodes.Expression(
+        expr0="abs({0}.x) + abs({0}.y) + abs({0}.z) > 0".format(layer),
+        expr1="0",
+        expr2="0",
+        expr3="0",
+    )
+    coverage.setInput(0, node.input(0))
+
+    average = nuke.nodes.CurveTool(operation="Avg Intensities")
+    average["ROI"].setValue([0, 0, coverage.width(), coverage.height()])
+    average.setInput(0, coverage)
+    nuke.execute(average, frame, frame)
+    fraction = average["intensitydata"].valueAt(frame, 0)
+
+    nuke.delete(average)
+    nuke.delete(coverage)
+    return fraction
+
+
+def compare(path, reference_path, frame):
+    """Measure the difference between two renders.
+
+    Args:
+        path (str): The render to check.
+        reference_path (str): The render to check against.
+        frame (int): The frame to measure.
+
+    Returns:
+        tuple(float, float): The mean squared error over the red, green,
+            and blue channels, and the largest difference of any pixel.
+    """
+    render_read = nuke.nodes.Read(file=path.replace("\\", "/"))
+    reference_read = nuke.nodes.Read(file=reference_path.replace("\\", "/"))
+
+    difference = nuke.nodes.Merge2(operation="difference")
+    difference.setInput(0, reference_read)
+    difference.setInput(1, render_read)
+
+    squared = nuke.nodes.Expression(expr0="r*r", expr1="g*g", expr2="b*b", expr3="0")
+    squared.setInput(0, difference)
+
+    region = [0, 0, reference_read.width(), reference_read.height()]
+    average = nuke.nodes.CurveTool(operation="Avg Intensities")
+    average["ROI"].setValue(region)
+    average.setInput(0, squared)
+    maximum = nuke.nodes.CurveTool(operation="Max Luma Pixel")
+    maximum["ROI"].setValue(region)
+    maximum.setInput(0, difference)
+
+    nuke.execute(average, frame, frame)
+    nuke.execute(maximum, frame, frame)
+
+    mean_squared_error = sum(
+        average["intensitydata"].valueAt(frame, channel) for channel in range(3)
+    ) / 3.0
+    max_error = max(
+        maximum["maxlumapixvalue"].valueAt(frame, channel) for channel in range(3)
+    )
+
+    for node in (maximum, average, squared, difference, reference_read, render_read):
+        nuke.delete(node)
+
+    return mean_squared_error, max_error
+
+
+def psnr(mean_squared_error):
+    """Get the peak signal to noise ratio for a peak of 1.
+
+    Args:
+        mean_squared_error (float): The mean squared error.
+
+    Returns:
+        float: The PSNR in decibels.
+    """
+    if mean_squared_error <= 0.0:
+        return float("inf")
+    return 10.0 * math.log10(1.0 / mean_squared_error)
+
+
+def main(argv):
+    """Check, or update, the goldens of every example.
+
+    Args:
+        argv (list(str)): The command line arguments.
+
+    Returns:
+        int: 0 if every example passed, 1 otherwise.
+    """
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--update", action="store_true", help="Store new goldens and timings.")
+    parser.add_argument("--min-psnr", type=float, default=40.0, help="The lowest PSNR that passes.")
+    parser.add_argument("--max-error", type=float, default=0.05, help="The largest pixel difference that passes.")
+    parser.add_argument(
+        "--time-tolerance",
+        type=float,
+        default=0.25,
+        help="How much slower than the recorded timing a render may be, as a fraction.",
+    )
+    args = parser.parse_args(argv)
+
+    timings = {}
+    if os.path.exists(_TIMINGS_FILE):
+        with open(_TIMINGS_FILE) as timings_file:
+            timings = json.load(timings_file)
+
+    if not os.path.isdir(_GOLDEN_DIR):
+        os.makedirs(_GOLDEN_DIR)
+    render_dir = tempfile.mkdtemp()
+
+    failures = []
+    for script in _SCRIPTS:
+        script_path = os.path.join(_EXAMPLES_DIR, script)
+        open_script(script_path)
+        frame = nuke.root().firstFrame()
+        script_name = os.path.splitext(os.path.basename(script_path))[0]
+
+        for node in sorted(nuke.allNodes("N_RayReflect"), key=lambda node: node.name()):
+            name = "{}_{}".format(script_name, node.name())
+            golden_path = os.path.join(_GOLDEN_DIR, name + ".exr")
+
+            if not args.update and not (os.path.exists(golden_path) and name in timings):
+                failures.append(name)
+                print("{}: FAILED, the golden or its timing is missing".format(name))
+                continue
+
+            if surface_fraction(node, frame) == 0.0:
+                failures.append(name)
+                print("{}: FAILED, no surface in the normals".format(name))
+                continue
+
+            # Compile the kernels before timing, with a different sample
+            # count so the timed render is not read back from the cache
+            node["ray_samples"].setValue(1)
+            render(node, os.path.join(render_dir, name + "_warm_up.exr"), frame)
+            node["ray_samples"].setValue(_RAY_SAMPLES)
+
+            if args.update:
+                timings[name] = render(node, golden_path, frame)
+                print("{}: updated, {:.2f}s".format(name, timings[name]))
+                continue
+
+            render_path = os.path.join(render_dir, name + ".exr")
+            elapsed = render(node, render_path, frame)
+            mean_squared_error, max_error = compare(render_path, golden_path, frame)
+
+            problems = []
+            if psnr(mean_squared_error) < args.min_psnr:
+                problems.append("PSNR {:.1f}dB".format(psnr(mean_squared_error)))
+            if max_error > args.max_error:
+                problems.append("max error {:.4f}".format(max_error))
+            if elapsed > timings[name] * (1.0 + args.time_tolerance):
+                problems.append("{:.2f}s against {:.2f}s".format(elapsed, timings[name]))
+
+            if problems:
+                failures.append(name)
+            print(
+                "{}: {}, PSNR {:.1f}dB, max error {:.4f}, {:.2f}s".format(
+                    name,
+                    "FAILED " + ", ".join(problems) if problems else "passed",
+                    psnr(mean_squared_error),
+                    max_error,
+                    elapsed,
+                )
+            )
+
+    if args.update:
+        with open(_TIMINGS_FILE, "w") as timings_file:
+            json.dump(timings, timings_file, indent=4, sort_keys=True)
+
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
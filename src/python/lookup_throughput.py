@@ -0,0 +1,145 @@
+"""Measure the render time saved by reading scattered rays from a small HDRI.
+
+Run this from Nuke's terminal mode:
+
+    nuke -t src/python/lookup_throughput.py --output lookup_throughput.csv
+
+The HDRI of the material fixture is scaled up to each of the given widths
+so that it no longer fits in the processor's caches. Every N_RayReflect
+node is then rendered reading the full HDRI for every ray, with the
+precomputed irradiance, also reading the downscaled copy for rough and
+diffuse rays, and also sharing the random samples across coherent
+tiles. Python cannot read the processor's cache
+miss counters, so the render time and the pixels shaded per second stand
+in for them. Run the same renders under a profiler, such as perf, to
+count the misses.
+"""
+import argparse
+import csv
+import os
+import sys
+import tempfile
+
+import nuke
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import check_examples
+import sample_convergence
+
+
+_FIXTURE_SCRIPT = os.path.join(
+    os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__)))),
+    "examples",
+    "material_fixture.nk",
+)
+
+_OPTIONS = [
+    (
+        "full hdri",
+        {"enable_precomputed_irradiance": False, "rough_lookup_threshold": 1.0, "coherent_tile_size": 0},
+    ),
+    (
+        "precomputed irradiance",
+        {"enable_precomputed_irradiance": True, "rough_lookup_threshold": 1.0, "coherent_tile_size": 0},
+    ),
+    (
+        "rough lookup",
+        {"enable_precomputed_irradiance": True, "rough_lookup_threshold": 0.25, "coherent_tile_size": 0},
+    ),
+    (
+        "rough lookup and coherent tiles",
+        {"enable_precomputed_irradiance": True, "rough_lookup_threshold": 0.25, "coherent_tile_size": 8},
+    ),
+]
+
+def main(argv):
+    """Write the render time of every lookup option to a CSV.
+
+    Args:
+        argv (list(str)): The command line arguments.
+
+    Returns:
+        int: 0 if the CSV was written, 1 if a node has no surface.
+    """
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--script", default=_FIXTURE_SCRIPT, help="The script to render.")
+    parser.add_argument("--output", default="lookup_throughput.csv", help="The CSV to write.")
+    parser.add_argument(
+        "--hdri-widths",
+        type=int,
+        nargs="+",
+        default=[2048, 8192, 16384],
+        help="The widths to scale the HDRI to, the height is half the width.",
+    )
+    parser.add_argument("--samples", type=int, default=16, help="The ray samples of every render.")
+    parser.add_argument("--repeats", type=int, default=3, help="The fastest of this many renders is kept.")
+    args = parser.parse_args(argv)
+
+    check_examples.open_script(args.script)
+    frame = nuke.root().firstFrame()
+    render_dir = tempfile.mkdtemp()
+    nodes = sorted(nuke.allNodes("N_RayReflect"), key=lambda node: node.name())
+
+    for node in nodes:
+        if check_examples.surface_fraction(node, frame) == 0.0:
+            print("{} has no surface in its normals, nothing was written".format(node.name()))
+            return 1
+
+    # Scale every node's HDRI input up to the width being measured
+    resize = nuke.nodes.Reformat(type="to box", box_fixed=True, filter="Impulse")
+    resize.setInput(0, nodes[0].input(1))
+    for node in nodes:
+        node.setInput(1, resize)
+
+    with open(args.output, "w") as output_file:
+        writer = csv.writer(output_file)
+        writer.writerow(
+            ["hdri_width", "material", "node", "option", "ray_samples", "seconds", "megapixels_per_second"]
+        )
+
+        for width in args.hdri_widths:
+            resize["box_width"].setValue(width)
+            resize["box_height"].setValue(width // 2)
+
+            for node in nodes:
+                material = sample_convergence.material_type(node)
+                node["output_lobe"].setValue(0)
+                node["preview_resolution"].setValue(0)
+                megapixels = node.width() * node.height() / 1000000.0
+
+                # Compile the kernels before timing
+                node["ray_samples"].setValue(1)
+                check_examples.render(node, os.path.join(render_dir, "warm_up.exr"), frame)
+                node["ray_samples"].setValue(args.samples)
+
+                for option, values in _OPTIONS:
+                    sample_convergence.set_knobs(node, values)
+
+                    seconds = float("inf")
+                    for _ in range(args.repeats):
+                        # Otherwise the repeats are read back from the cache
+                        nuke.clearRAMCache()
+                        seconds = min(
+                            seconds,
+                            check_examples.render(node, os.path.join(render_dir, "render.exr"), frame),
+                        )
+
+                    writer.writerow(
+                        [width, material, node.name(), option, args.samples, seconds, megapixels / seconds]
+                    )
+                    print(
+                        "{} wide, {} {}, {}: {:.2f}s, {:.3f} megapixels per second".format(
+                            width,
+                            material,
+                            node.name(),
+                            option,
+                            seconds,
+                            megapixels / seconds,
+                        )
+                    )
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
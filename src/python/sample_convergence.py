@@ -0,0 +1,173 @@
+"""Measure how quickly each sampling option converges, per material.
+
+Run this from Nuke's terminal mode:
+
+    nuke -t src/python/sample_convergence.py --output convergence.csv
+
+Every N_RayReflect node in the material fixture is rendered once with a
+very high "Ray Samples" as a reference. The benchmark stops before
+writing anything if a node's normals hold no surface, as the background
+alone converges immediately. It is then rendered at each of
+the sample counts with each sampling option. The RMS error against the
+reference, the render time, and the sample count of every render are
+written to the CSV, with the material the node shades.
+"""
+import argparse
+import csv
+import math
+import os
+import sys
+import tempfile
+
+import nuke
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import check_examples
+
+
+_EXAMPLE_SCRIPT = os.path.join(
+    os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__)))),
+    "examples",
+    "material_fixture.nk",
+)
+
+# The knob values of each sampling option, every option starts from
+# plain sampling of the full HDRI
+_PLAIN = {
+    "enable_precomputed_irradiance": False,
+    "enable_light_extraction": False,
+    "coherent_tile_size": 0,
+    "enable_denoise": False,
+}
+_OPTIONS = [
+    ("plain", {}),
+    ("precomputed irradiance", {"enable_precomputed_irradiance": True}),
+    ("light extraction", {"enable_light_extraction": True}),
+    ("coherent tiles", {"coherent_tile_size": 8}),
+    ("denoise", {"enable_denoise": True}),
+]
+
+
+def material_type(node):
+    """Name the material a node shades, from its material knobs.
+
+    Args:
+        node (nuke.Node): The N_RayReflect node.
+
+    Returns:
+        str: The material type.
+    """
+    if node["use_material_table"].value():
+        return "table"
+    if node["use_transmission_input"].value() or node["use_specular_input"].value():
+        return "textured"
+    if node["transmission"].value() > 0.0:
+        return "transmissive"
+    if node["specular"].value() > 0.0:
+        if node["use_specular_roughness_input"].value() or node["specular_roughness"].value() > 0.0:
+            return "rough specular"
+        return "specular"
+    return "diffuse"
+
+
+def set_knobs(node, values):
+    """Set the knobs of a node.
+
+    Args:
+        node (nuke.Node): The node.
+        values (dict): The knob values by knob name.
+    """
+    for name, value in values.items():
+        node[name].setValue(value)
+
+
+def main(argv):
+    """Write the convergence of every option to a CSV.
+
+    Args:
+        argv (list(str)): The command line arguments.
+
+    Returns:
+        int: 0 if the CSV was written, 1 if a node has no surface.
+    """
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument(
+        "--script",
+        default=_EXAMPLE_SCRIPT,
+        help="The script to render, each N_RayReflect node should shade one material.",
+    )
+    parser.add_argument("--output", default="sample_convergence.csv", help="The CSV to write.")
+    parser.add_argument(
+        "--samples",
+        type=int,
+        nargs="+",
+        default=[1, 2, 4, 8, 16, 32, 64],
+        help="The ray sample counts to measure.",
+    )
+    parser.add_argument(
+        "--reference-samples",
+        type=int,
+        default=1024,
+        help="The ray samples of the reference render.",
+    )
+    args = parser.parse_args(argv)
+
+    check_examples.open_script(args.script)
+    frame = nuke.root().firstFrame()
+    render_dir = tempfile.mkdtemp()
+    nodes = sorted(nuke.allNodes("N_RayReflect"), key=lambda node: node.name())
+
+    # The references also compile the kernels, so the later renders are
+    # timed without the compile
+    reference_paths = {}
+    for node in nodes:
+        if check_examples.surface_fraction(node, frame) == 0.0:
+            print("{} has no surface in its normals, nothing was written".format(node.name()))
+            return 1
+
+        node["output_lobe"].setValue(0)
+        node["preview_resolution"].setValue(0)
+        set_knobs(node, _PLAIN)
+        node["ray_samples"].setValue(args.reference_samples)
+        reference_paths[node.name()] = os.path.join(render_dir, node.name() + "_reference.exr")
+        check_examples.render(node, reference_paths[node.name()], frame)
+
+    with open(args.output, "w") as output_file:
+        writer = csv.writer(output_file)
+        writer.writerow(["material", "node", "option", "ray_samples", "rmse", "seconds"])
+
+        for node in nodes:
+            material = material_type(node)
+            reference_path = reference_paths[node.name()]
+
+            for option, values in _OPTIONS:
+                set_knobs(node, _PLAIN)
+                set_knobs(node, values)
+                if node["enable_light_extraction"].value():
+                    node["extract_light"].execute()
+
+                for samples in args.samples:
+                    node["ray_samples"].setValue(samples)
+                    render_path = os.path.join(render_dir, "{}_{}.exr".format(node.name(), samples))
+                    seconds = check_examples.render(node, render_path, frame)
+                    mean_squared_error, _ = check_examples.compare(render_path, reference_path, frame)
+
+                    writer.writerow(
+                        [material, node.name(), option, samples, math.sqrt(mean_squared_error), seconds]
+                    )
+                    print(
+                        "{} {}, {}, {} samples: RMSE {:.5f}, {:.2f}s".format(
+                            material,
+                            node.name(),
+                            option,
+                            samples,
+                            math.sqrt(mean_squared_error),
+                            seconds,
+                        )
+                    )
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))